@@ -0,0 +1,543 @@
+/**************************************************************************/ /**
+ * @brief Generate RTCM corrections files from archived receiver and SSR logs.
+ *
+ * This application uses the Point One `libosr_producer` library to convert
+ * previously recorded data into RTCM 10403.3 corrections files, without a live
+ * receiver. It is intended for post-mission analysis and regression testing.
+ *
+ * Each session consists of a Septentrio SBF log and one or more corrections
+ * logs (Polaris SSR, raw L-band SSR, and/or OSR). Sessions are independent of
+ * each other, and are processed in parallel on a pool of worker threads, one
+ * `OSRProducer` instance per session. Geoid data is loaded once and shared by
+ * all producers.
+ *
+ * See `README.md` for more details and usage examples.
+ ******************************************************************************/
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "log_reader.h"
+#include "point_one/polaris/osr_producer.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Batch Processing Settings
+////////////////////////////////////////////////////////////////////////////////
+
+DEFINE_string(output_dir, ".",
+              "The directory in which to write the generated RTCM files. Each "
+              "file is named after the session's SBF log, with a .rtcm3 "
+              "extension.");
+
+DEFINE_uint32(threads, 0,
+              "The number of sessions to process in parallel. If 0, use one "
+              "thread per available CPU core.");
+
+DEFINE_uint32(read_size, 65536,
+              "The number of bytes to read from each log file at a time.");
+
+////////////////////////////////////////////////////////////////////////////////
+// SSR->OSR Data Control
+////////////////////////////////////////////////////////////////////////////////
+
+DEFINE_uint32(rtcm_msm_type, 4,
+              "The type of RTCM MSM messages (1-7) to produce when using SSR "
+              "corrections.");
+
+DEFINE_uint32(rtcm_id, 0,
+              "The base station ID to use when using SSR corrections.");
+
+DEFINE_uint32(rtcm_position_type, 1005,
+              "The type of RTCM position message to generate when using SSR "
+              "corrections.");
+
+DEFINE_string(geoid_file, "_deps/libosr_producer-src/data/egm2008-15.pgm",
+              "The path to a *.pgm file containing geoid data.");
+
+/******************************************************************************/
+using namespace point_one::polaris;
+using namespace point_one::applications;
+
+namespace {
+
+enum class InputType { SBF, POLARIS_SSR, LBAND_SSR, OSR };
+
+constexpr double SECONDS_PER_WEEK = 7 * 24 * 3600.0;
+
+// Scan this much of the end of an SBF log to find its last timestamp.
+constexpr long SBF_TAIL_SCAN_BYTES = 1 << 20;
+
+struct InputFile {
+  InputType type;
+  std::unique_ptr<LogReader> reader;
+  LogReader::Message message;
+  bool has_message = false;
+  // GPS time (sec) of the most recent timed message from this file.
+  double last_time_sec = NAN;
+};
+
+struct Session {
+  std::vector<std::pair<InputType, std::string>> inputs;
+  std::string output_path;
+};
+
+struct SessionResult {
+  bool success = false;
+  long in_bytes = 0;
+  long out_bytes = 0;
+  double cpu_sec = 0.0;
+};
+
+/******************************************************************************/
+double GetThreadCPUTimeSec() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/******************************************************************************/
+bool ParseSession(const std::string& arg, Session* session) {
+  std::istringstream stream(arg);
+  std::string entry;
+  while (std::getline(stream, entry, ',')) {
+    if (session->inputs.empty()) {
+      if (entry.empty() || entry.find('=') != std::string::npos) {
+        LOG(ERROR) << "Invalid session \"" << arg
+                   << "\". The first entry must be an SBF log path.";
+        return false;
+      }
+      session->inputs.emplace_back(InputType::SBF, entry);
+      continue;
+    }
+
+    size_t separator = entry.find('=');
+    std::string key = entry.substr(0, separator);
+    std::string path =
+        separator == std::string::npos ? "" : entry.substr(separator + 1);
+    InputType type;
+    if (key == "ssr") {
+      type = InputType::POLARIS_SSR;
+    }
+    else if (key == "lband") {
+      type = InputType::LBAND_SSR;
+    }
+    else if (key == "osr") {
+      type = InputType::OSR;
+    }
+    else {
+      LOG(ERROR) << "Invalid session \"" << arg << "\". Unrecognized input \""
+                 << entry << "\". Expected ssr=PATH, lband=PATH, or osr=PATH.";
+      return false;
+    }
+    if (path.empty()) {
+      LOG(ERROR) << "Invalid session \"" << arg << "\". No path specified for "
+                 << key << " input.";
+      return false;
+    }
+    session->inputs.emplace_back(type, path);
+  }
+
+  if (session->inputs.empty()) {
+    LOG(ERROR) << "Invalid session \"" << arg
+               << "\". The first entry must be an SBF log path.";
+    return false;
+  }
+  else if (session->inputs.size() == 1) {
+    LOG(ERROR) << "Invalid session \"" << arg
+               << "\". At least one corrections log (ssr=PATH, lband=PATH, or "
+                  "osr=PATH) must be specified.";
+    return false;
+  }
+
+  // Check that the input files exist before starting any work.
+  for (const auto& input : session->inputs) {
+    if (!std::ifstream(input.second)) {
+      LOG(ERROR) << "Invalid session \"" << arg << "\". Unable to open \""
+                 << input.second << "\".";
+      return false;
+    }
+  }
+
+  // Name the output file after the SBF log.
+  std::string name = session->inputs[0].second;
+  size_t pos = name.find_last_of('/');
+  if (pos != std::string::npos) {
+    name = name.substr(pos + 1);
+  }
+  pos = name.find_last_of('.');
+  if (pos != std::string::npos && pos > 0) {
+    name = name.substr(0, pos);
+  }
+  session->output_path = FLAGS_output_dir + "/" + name + ".rtcm3";
+
+  return true;
+}
+
+/******************************************************************************/
+bool OpenInput(InputType type, const std::string& path,
+               std::vector<std::unique_ptr<InputFile>>* inputs) {
+  std::unique_ptr<InputFile> input(new InputFile());
+  input->type = type;
+  input->reader.reset(new LogReader(type == InputType::SBF
+                                        ? LogReader::Format::SBF
+                                        : LogReader::Format::RTCM3,
+                                    FLAGS_read_size));
+  if (!input->reader->Open(path)) {
+    LOG(ERROR) << "Unable to open \"" << path << "\".";
+    return false;
+  }
+  input->has_message = input->reader->ReadNext(&input->message);
+  inputs->push_back(std::move(input));
+  return true;
+}
+
+/******************************************************************************/
+// Find the GPS time (sec) of the first and last timed messages in an SBF log.
+void GetSBFTimeRange(const std::string& path, double* start_time_sec,
+                     double* end_time_sec) {
+  *start_time_sec = NAN;
+  *end_time_sec = NAN;
+
+  LogReader::Message message;
+  LogReader reader(LogReader::Format::SBF, FLAGS_read_size);
+  if (!reader.Open(path)) {
+    return;
+  }
+  while (reader.ReadNext(&message)) {
+    if (!std::isnan(message.tow_sec)) {
+      *start_time_sec = message.week * SECONDS_PER_WEEK + message.tow_sec;
+      break;
+    }
+  }
+
+  LogReader tail_reader(LogReader::Format::SBF, FLAGS_read_size);
+  if (!tail_reader.Open(path, reader.GetSizeBytes() - SBF_TAIL_SCAN_BYTES)) {
+    return;
+  }
+  while (tail_reader.ReadNext(&message)) {
+    if (!std::isnan(message.tow_sec)) {
+      *end_time_sec = message.week * SECONDS_PER_WEEK + message.tow_sec;
+    }
+  }
+}
+
+/******************************************************************************/
+// Get the GPS time (sec) at which to pass an input file's current message to
+// the producer.
+double GetMessageTimeSec(const InputFile& input, double reference_time_sec,
+                         double sbf_start_time_sec, double sbf_end_time_sec) {
+  const LogReader::Message& message = input.message;
+  if (!std::isnan(message.tow_sec)) {
+    // RTCM messages only include time of week. Use the week closest to the
+    // current SBF time.
+    if (message.week >= 0) {
+      return message.week * SECONDS_PER_WEEK + message.tow_sec;
+    }
+    else if (std::isnan(reference_time_sec)) {
+      return message.tow_sec;
+    }
+    else {
+      double week = std::round((reference_time_sec - message.tow_sec) /
+                               SECONDS_PER_WEEK);
+      return week * SECONDS_PER_WEEK + message.tow_sec;
+    }
+  }
+
+  // Messages without a time (e.g., ephemeris) are passed along immediately
+  // after the preceding message from the same file.
+  if (!std::isnan(input.last_time_sec)) {
+    return input.last_time_sec;
+  }
+
+  // If we have not found a time in this file yet (or it does not contain any
+  // timed messages we can decode), estimate the time from the position in the
+  // file, assuming it spans the same time as the SBF log.
+  if (!std::isnan(sbf_start_time_sec) && !std::isnan(sbf_end_time_sec) &&
+      input.reader->GetSizeBytes() > 0) {
+    long offset_bytes = input.reader->GetReadBytes() - message.size_bytes;
+    double fraction = (double)offset_bytes / input.reader->GetSizeBytes();
+    return sbf_start_time_sec +
+           fraction * (sbf_end_time_sec - sbf_start_time_sec);
+  }
+
+  return -INFINITY;
+}
+
+/******************************************************************************/
+SessionResult ProcessSession(const Session& session) {
+  SessionResult result;
+
+  // Open the input files.
+  std::vector<std::unique_ptr<InputFile>> inputs;
+  for (const auto& input : session.inputs) {
+    if (!OpenInput(input.first, input.second, &inputs)) {
+      return result;
+    }
+  }
+
+  std::ofstream output(session.output_path, std::ios::binary);
+  if (!output) {
+    LOG(ERROR) << "Unable to open \"" << session.output_path
+               << "\" for writing.";
+    return result;
+  }
+
+  // Create the producer for this session. Each session has its own producer,
+  // accessed only by this thread, so no locking is needed.
+  OSRConfiguration config;
+  config.rtcm_msm_type_ = FLAGS_rtcm_msm_type;
+  config.rtcm_station_id_ = FLAGS_rtcm_id;
+  config.rtcm_position_type_ = FLAGS_rtcm_position_type;
+  config.receiver_type_ = OSRConfiguration::ReceiverType::SEPTENTRIO_SBF;
+  OSRProducer producer(config);
+  producer.SetRTCMCallback([&](const uint8_t* buffer, size_t size_bytes) {
+    result.out_bytes += size_bytes;
+    output.write(reinterpret_cast<const char*>(buffer), size_bytes);
+  });
+
+  // Pass the data to the producer in time order, using the GPS time of each
+  // SBF block and each RTCM SSR/MSM message, so that the corrections given to
+  // the producer match the receiver's epochs. Messages from the same file are
+  // always passed in file order.
+  double sbf_start_time_sec, sbf_end_time_sec;
+  GetSBFTimeRange(session.inputs[0].second, &sbf_start_time_sec,
+                  &sbf_end_time_sec);
+  double reference_time_sec = sbf_start_time_sec;
+  while (true) {
+    // Find the earliest message. For messages with the same time, pass
+    // corrections before receiver data so they are available when the
+    // receiver's epoch triggers RTCM generation.
+    InputFile* next = nullptr;
+    double next_time_sec = 0.0;
+    for (auto& input : inputs) {
+      if (!input->has_message) {
+        continue;
+      }
+      double time_sec =
+          GetMessageTimeSec(*input, reference_time_sec, sbf_start_time_sec,
+                            sbf_end_time_sec);
+      if (next == nullptr || time_sec < next_time_sec ||
+          (time_sec == next_time_sec && next->type == InputType::SBF &&
+           input->type != InputType::SBF)) {
+        next = input.get();
+        next_time_sec = time_sec;
+      }
+    }
+    if (next == nullptr) {
+      break;
+    }
+
+    if (!std::isnan(next->message.tow_sec)) {
+      next->last_time_sec = next_time_sec;
+      if (next->type == InputType::SBF) {
+        reference_time_sec = next_time_sec;
+      }
+    }
+
+    const uint8_t* data = next->message.data;
+    size_t size_bytes = next->message.size_bytes;
+    result.in_bytes += size_bytes;
+    switch (next->type) {
+      case InputType::SBF:
+        producer.HandleReceiverData(data, size_bytes);
+        break;
+      case InputType::POLARIS_SSR:
+        producer.HandleSSR(data, size_bytes);
+        break;
+      case InputType::LBAND_SSR:
+        producer.HandleSecondarySSR(data, size_bytes);
+        break;
+      case InputType::OSR:
+        producer.HandleOSR(data, size_bytes);
+        break;
+    }
+
+    next->has_message = next->reader->ReadNext(&next->message);
+  }
+
+  output.close();
+  if (!output) {
+    LOG(ERROR) << "Error writing \"" << session.output_path << "\".";
+    return result;
+  }
+
+  result.success = true;
+  return result;
+}
+
+} // namespace
+
+/******************************************************************************/
+int main(int argc, char* argv[]) {
+  FLAGS_logtostderr = true;
+  FLAGS_colorlogtostderr = true;
+  gflags::SetUsageMessage(
+      "Generate RTCM corrections files from archived SBF and corrections logs."
+      "\n\nUsage: batch_osr_example [OPTION]... SESSION...\n\n"
+      "Each SESSION is specified as an SBF log followed by one or more "
+      "corrections logs:\n"
+      "  SBF_FILE[,ssr=SSR_FILE][,lband=LBAND_FILE][,osr=OSR_FILE]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  google::InitGoogleLogging(argv[0]);
+
+  LOG(INFO) << "OSR producer version: " << OSRProducer::VERSION_STR;
+
+  // Parse the session list.
+  std::vector<Session> sessions;
+  std::set<std::string> output_paths;
+  for (int i = 1; i < argc; ++i) {
+    Session session;
+    if (!ParseSession(argv[i], &session)) {
+      return 1;
+    }
+    else if (!output_paths.insert(session.output_path).second) {
+      LOG(ERROR) << "Multiple sessions would write to \""
+                 << session.output_path << "\". SBF log names must be unique.";
+      return 1;
+    }
+    sessions.push_back(session);
+  }
+
+  if (sessions.empty()) {
+    LOG(ERROR) << "No sessions specified. See --help for usage.";
+    return 1;
+  }
+
+  // Check the output directory before doing any work.
+  struct stat output_dir_stat;
+  if (stat(FLAGS_output_dir.c_str(), &output_dir_stat) != 0 ||
+      !S_ISDIR(output_dir_stat.st_mode)) {
+    LOG(ERROR) << "Output directory \"" << FLAGS_output_dir
+               << "\" does not exist.";
+    return 1;
+  }
+  else if (access(FLAGS_output_dir.c_str(), W_OK | X_OK) != 0) {
+    LOG(ERROR) << "Output directory \"" << FLAGS_output_dir
+               << "\" is not writable.";
+    return 1;
+  }
+
+  // Load geoid data. This is shared by all producer instances.
+  if (FLAGS_geoid_file.empty()) {
+    LOG(ERROR) << "No geoid data file.";
+    return 1;
+  }
+  if (!OSRProducer::LoadGeoidData(FLAGS_geoid_file)) {
+    LOG(ERROR) << "Unable to load geoid data file \"" << FLAGS_geoid_file
+               << "\".";
+    return 1;
+  }
+
+  // Process the sessions on a pool of worker threads. Each worker takes the
+  // next unprocessed session until none remain.
+  unsigned num_threads = FLAGS_threads;
+  if (num_threads == 0) {
+    num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  num_threads = std::min<unsigned>(num_threads, sessions.size());
+  LOG(INFO) << "Processing " << sessions.size() << " session(s) using "
+            << num_threads << " thread(s).";
+
+  std::vector<SessionResult> results(sessions.size());
+  std::vector<double> thread_cpu_sec(num_threads, 0.0);
+  std::atomic<size_t> next_session(0);
+  auto start_time = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < num_threads; ++t) {
+    workers.emplace_back([&, t]() {
+      size_t index;
+      while ((index = next_session++) < sessions.size()) {
+        auto session_start_time = std::chrono::steady_clock::now();
+        double start_cpu_sec = GetThreadCPUTimeSec();
+        results[index] = ProcessSession(sessions[index]);
+        results[index].cpu_sec = GetThreadCPUTimeSec() - start_cpu_sec;
+        thread_cpu_sec[t] += results[index].cpu_sec;
+
+        const SessionResult& result = results[index];
+        if (result.success) {
+          double elapsed_sec = std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() -
+                                   session_start_time)
+                                   .count();
+          LOG(INFO) << "Wrote " << result.out_bytes << " bytes to \""
+                    << sessions[index].output_path << "\" ("
+                    << result.in_bytes << " bytes in, " << std::fixed
+                    << std::setprecision(2)
+                    << result.in_bytes / 1e6 / elapsed_sec << " MB/s).";
+        }
+        else {
+          LOG(ERROR) << "Failed to process session for \""
+                     << sessions[index].inputs[0].second << "\".";
+        }
+      }
+    });
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  double elapsed_sec =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    start_time)
+          .count();
+
+  // Report throughput.
+  long in_bytes = 0;
+  long out_bytes = 0;
+  double cpu_sec = 0.0;
+  int num_failed = 0;
+  for (const auto& result : results) {
+    in_bytes += result.in_bytes;
+    out_bytes += result.out_bytes;
+    cpu_sec += result.cpu_sec;
+    if (!result.success) {
+      ++num_failed;
+    }
+  }
+
+  LOG(INFO) << "Throughput Stats (" << std::fixed << std::setprecision(2)
+            << elapsed_sec << " sec, " << num_threads << " thread(s)):";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << in_bytes
+            << "  Bytes read from logs";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << out_bytes
+            << "  RTCM bytes written";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+            << std::setprecision(2) << in_bytes / 1e6 / elapsed_sec
+            << "  Total MB/s";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+            << std::setprecision(2)
+            << (cpu_sec > 0.0 ? in_bytes / 1e6 / cpu_sec : 0.0)
+            << "  MB per CPU second (per-core throughput)";
+  for (unsigned t = 0; t < num_threads; ++t) {
+    LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+              << std::setprecision(2) << 100.0 * thread_cpu_sec[t] / elapsed_sec
+              << "  Thread " << t << " CPU utilization (%)";
+  }
+
+  if (num_failed > 0) {
+    LOG(ERROR) << num_failed << " of " << sessions.size()
+               << " session(s) failed.";
+    return 1;
+  }
+
+  return 0;
+}
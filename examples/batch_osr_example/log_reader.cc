@@ -0,0 +1,252 @@
+/**
+ * @brief Read SBF or RTCM 3 messages, and their GPS time, from a log file.
+ */
+
+#include "log_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace point_one::applications;
+
+namespace {
+
+constexpr uint8_t SBF_SYNC[2] = {'$', '@'};
+constexpr size_t SBF_HEADER_SIZE = 8;
+
+constexpr uint8_t RTCM3_PREAMBLE = 0xD3;
+constexpr size_t RTCM3_HEADER_SIZE = 3;
+constexpr size_t RTCM3_CRC_SIZE = 3;
+
+// Limit the size of runs of unframed data, so that files we cannot decode are
+// still returned in small pieces.
+constexpr size_t MAX_UNFRAMED_SIZE = 1024;
+
+/******************************************************************************/
+uint16_t CRC16CCITT(const uint8_t* data, size_t size_bytes) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < size_bytes; ++i) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/******************************************************************************/
+uint32_t CRC24Q(const uint8_t* data, size_t size_bytes) {
+  uint32_t crc = 0;
+  for (size_t i = 0; i < size_bytes; ++i) {
+    crc ^= (uint32_t)data[i] << 16;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc <<= 1;
+      if (crc & 0x1000000) {
+        crc ^= 0x1864CFB;
+      }
+    }
+  }
+  return crc & 0xFFFFFF;
+}
+
+/******************************************************************************/
+uint32_t GetBits(const uint8_t* data, size_t offset_bits, size_t num_bits) {
+  uint32_t value = 0;
+  for (size_t i = offset_bits; i < offset_bits + num_bits; ++i) {
+    value = (value << 1) | ((data[i / 8] >> (7 - i % 8)) & 1);
+  }
+  return value;
+}
+
+/******************************************************************************/
+uint32_t GetU32LE(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/******************************************************************************/
+uint16_t GetU16LE(const uint8_t* data) { return data[0] | (data[1] << 8); }
+
+/******************************************************************************/
+// Get the GPS time of week (sec) of an RTCM 3 message, or NAN if the message
+// does not contain a time or uses GLONASS time.
+double GetRTCM3TimeOfWeek(const uint8_t* payload, size_t size_bytes) {
+  if (size_bytes < 8) {
+    return NAN;
+  }
+
+  // BeiDou time is 14 seconds behind GPS time.
+  static constexpr double BDS_TO_GPS_SEC = 14.0;
+
+  unsigned message_type = GetBits(payload, 0, 12);
+
+  // MSM observations: 30-bit epoch time (ms) following the station ID.
+  if (message_type >= 1071 && message_type <= 1127 &&
+      message_type % 10 >= 1 && message_type % 10 <= 7) {
+    unsigned system = message_type / 10;
+    if (system == 108) {
+      // GLONASS
+      return NAN;
+    }
+    double tow_sec = GetBits(payload, 24, 30) * 1e-3;
+    return system == 112 ? tow_sec + BDS_TO_GPS_SEC : tow_sec;
+  }
+
+  // RTCM SSR: 20-bit epoch time (sec) following the message type.
+  if ((message_type >= 1057 && message_type <= 1062) ||
+      (message_type >= 1240 && message_type <= 1257)) {
+    return GetBits(payload, 12, 20);
+  }
+  else if (message_type >= 1258 && message_type <= 1263) {
+    return GetBits(payload, 12, 20) + BDS_TO_GPS_SEC;
+  }
+
+  // IGS SSR: 20-bit epoch time (sec) following the version and subtype.
+  if (message_type == 4076) {
+    unsigned system = GetBits(payload, 15, 8) / 20;
+    if (system == 2) {
+      // GLONASS
+      return NAN;
+    }
+    double tow_sec = GetBits(payload, 23, 20);
+    return system == 5 ? tow_sec + BDS_TO_GPS_SEC : tow_sec;
+  }
+
+  return NAN;
+}
+
+} // namespace
+
+/******************************************************************************/
+LogReader::LogReader(Format format, size_t read_size)
+    : format_(format), read_size_(std::max<size_t>(read_size, 1)) {}
+
+/******************************************************************************/
+bool LogReader::Open(const std::string& path, long offset_bytes) {
+  stream_.open(path, std::ios::binary | std::ios::ate);
+  if (!stream_) {
+    return false;
+  }
+  size_bytes_ = stream_.tellg();
+  read_bytes_ = std::min(std::max(offset_bytes, 0l), size_bytes_);
+  stream_.seekg(read_bytes_);
+  start_ = end_ = 0;
+  return true;
+}
+
+/******************************************************************************/
+bool LogReader::ReadNext(Message* message) {
+  *message = Message();
+  if (!Fill(1)) {
+    return false;
+  }
+
+  bool framed = format_ == Format::SBF ? ParseSBF(message)
+                                       : ParseRTCM3(message);
+  if (!framed) {
+    // Return everything up to the next possible message.
+    size_t sync = FindSync(start_ + 1);
+    message->data = buffer_.data() + start_;
+    message->size_bytes = std::min(sync - start_, MAX_UNFRAMED_SIZE);
+  }
+
+  start_ += message->size_bytes;
+  read_bytes_ += message->size_bytes;
+  return true;
+}
+
+/******************************************************************************/
+bool LogReader::Fill(size_t size_bytes) {
+  if (end_ - start_ >= size_bytes) {
+    return true;
+  }
+
+  // Move unread data to the front of the buffer, and grow it if needed.
+  if (start_ > 0) {
+    std::memmove(buffer_.data(), buffer_.data() + start_, end_ - start_);
+    end_ -= start_;
+    start_ = 0;
+  }
+  buffer_.resize(std::max(buffer_.size(), std::max(size_bytes, read_size_)));
+
+  while (end_ < size_bytes && stream_) {
+    stream_.read(reinterpret_cast<char*>(buffer_.data() + end_),
+                 buffer_.size() - end_);
+    end_ += stream_.gcount();
+  }
+
+  return end_ >= size_bytes;
+}
+
+/******************************************************************************/
+size_t LogReader::FindSync(size_t offset) const {
+  for (size_t i = offset; i < end_; ++i) {
+    if (format_ == Format::SBF ? buffer_[i] == SBF_SYNC[0]
+                               : buffer_[i] == RTCM3_PREAMBLE) {
+      return i;
+    }
+  }
+  return end_;
+}
+
+/******************************************************************************/
+bool LogReader::ParseSBF(Message* message) {
+  // Header: sync (2), CRC (2), ID (2), length (2). The CRC covers everything
+  // following it. All SBF blocks begin with TOW (ms) and WNc.
+  if (!Fill(SBF_HEADER_SIZE) || buffer_[start_] != SBF_SYNC[0] ||
+      buffer_[start_ + 1] != SBF_SYNC[1]) {
+    return false;
+  }
+
+  size_t size_bytes = GetU16LE(&buffer_[start_ + 6]);
+  if (size_bytes < SBF_HEADER_SIZE || size_bytes % 4 != 0 ||
+      !Fill(size_bytes)) {
+    return false;
+  }
+
+  const uint8_t* data = &buffer_[start_];
+  if (CRC16CCITT(data + 4, size_bytes - 4) != GetU16LE(data + 2)) {
+    return false;
+  }
+
+  message->data = data;
+  message->size_bytes = size_bytes;
+  if (size_bytes >= 14) {
+    uint32_t tow_ms = GetU32LE(data + 8);
+    uint16_t week = GetU16LE(data + 12);
+    if (tow_ms != 0xFFFFFFFF && week != 0xFFFF) {
+      message->week = week;
+      message->tow_sec = tow_ms * 1e-3;
+    }
+  }
+  return true;
+}
+
+/******************************************************************************/
+bool LogReader::ParseRTCM3(Message* message) {
+  // Header: preamble (8 bits), reserved (6 bits), length (10 bits). Followed by
+  // the payload and a 24-bit CRC covering the header and payload.
+  if (!Fill(RTCM3_HEADER_SIZE) || buffer_[start_] != RTCM3_PREAMBLE ||
+      (buffer_[start_ + 1] & 0xFC) != 0) {
+    return false;
+  }
+
+  size_t payload_size =
+      ((buffer_[start_ + 1] & 0x03) << 8) | buffer_[start_ + 2];
+  size_t size_bytes = RTCM3_HEADER_SIZE + payload_size + RTCM3_CRC_SIZE;
+  if (!Fill(size_bytes)) {
+    return false;
+  }
+
+  const uint8_t* data = &buffer_[start_];
+  const uint8_t* crc = data + RTCM3_HEADER_SIZE + payload_size;
+  if (CRC24Q(data, RTCM3_HEADER_SIZE + payload_size) !=
+      (((uint32_t)crc[0] << 16) | (crc[1] << 8) | crc[2])) {
+    return false;
+  }
+
+  message->data = data;
+  message->size_bytes = size_bytes;
+  message->tow_sec =
+      GetRTCM3TimeOfWeek(data + RTCM3_HEADER_SIZE, payload_size);
+  return true;
+}
@@ -0,0 +1,91 @@
+/**
+ * @brief Read SBF or RTCM 3 messages, and their GPS time, from a log file.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace point_one {
+namespace applications {
+
+class LogReader {
+ public:
+  enum class Format { SBF, RTCM3 };
+
+  /**
+   * @brief A message, or a run of bytes that could not be framed as one.
+   *
+   * The data pointer is valid until the next call to @ref ReadNext().
+   */
+  struct Message {
+    const uint8_t* data = nullptr;
+    size_t size_bytes = 0;
+    // GPS week number, or -1 if unknown (RTCM messages do not include it).
+    int week = -1;
+    // GPS time of week (sec), or NAN if the message does not contain a time.
+    double tow_sec = NAN;
+  };
+
+  LogReader() = delete;
+
+  /**
+   * @brief Construct a log reader.
+   *
+   * @param format The format of the messages in the log file.
+   * @param read_size The number of bytes to read from the file at a time.
+   */
+  LogReader(Format format, size_t read_size);
+
+  /**
+   * @brief Open a log file.
+   *
+   * @param path The path to the file.
+   * @param offset_bytes The offset at which to start reading.
+   *
+   * @return `true` on success, `false` if the file could not be opened.
+   */
+  bool Open(const std::string& path, long offset_bytes = 0);
+
+  /**
+   * @brief Read the next message from the file.
+   *
+   * Bytes that are not part of a valid message (e.g., corrupted data) are
+   * returned as-is, without a time, so that no data is lost.
+   *
+   * @param message The message.
+   *
+   * @return `true` on success, `false` at end of file.
+   */
+  bool ReadNext(Message* message);
+
+  long GetSizeBytes() const { return size_bytes_; }
+
+  long GetReadBytes() const { return read_bytes_; }
+
+ private:
+  Format format_;
+  std::ifstream stream_;
+  long size_bytes_ = 0;
+  long read_bytes_ = 0;
+
+  std::vector<uint8_t> buffer_;
+  size_t read_size_;
+  size_t start_ = 0;
+  size_t end_ = 0;
+
+  bool Fill(size_t size_bytes);
+
+  size_t FindSync(size_t offset) const;
+
+  bool ParseSBF(Message* message);
+
+  bool ParseRTCM3(Message* message);
+};
+
+} // namespace applications
+} // namespace point_one
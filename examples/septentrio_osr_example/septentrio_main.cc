@@ -15,11 +15,16 @@
  * See `README.md` for more details and usage examples.
  ******************************************************************************/
 
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
 #include <iomanip>
 #include <memory>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -28,6 +33,7 @@
 #include <boost/bind/bind.hpp>
 
 #include "serial_port.h"
+#include "ssr_beacon_manager.h"
 #include "point_one/polaris/osr_producer.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,6 +65,19 @@ DEFINE_string(polaris_ssr_hostname, "ssr.polaris.p1beta.com",
 DEFINE_string(polaris_ssr_api_hostname, "api.p1beta.com",
               "The hostname of the Polaris API server.");
 DEFINE_string(polaris_ssr_beacon, "", "The ID of the beacon providing SSR.");
+DEFINE_string(polaris_ssr_beacons, "",
+              "A set of SSR beacons and their coverage regions, formatted as "
+              "ID=LAT_MIN,LON_MIN,LAT_MAX,LON_MAX;ID=... (degrees). If set, "
+              "the beacon is selected automatically based on the receiver's "
+              "position and polaris_ssr_beacon is ignored.");
+DEFINE_double(polaris_ssr_preconnect_distance_km, 20.0,
+              "When using polaris_ssr_beacons, connect to a neighboring beacon "
+              "in advance when within this distance of its coverage region so "
+              "it is ready when the region boundary is crossed.");
+DEFINE_double(polaris_ssr_correction_window_sec, 30.0,
+              "When using polaris_ssr_beacons, the time over which a beacon "
+              "sends a complete set of SSR corrections. This much data from a "
+              "pre-connected beacon is buffered and replayed on handover.");
 DEFINE_string(polaris_ssr_api_key, "",
               "The API key to use when connecting to Polaris for SSR.");
 DEFINE_string(polaris_ssr_unique_id, "",
@@ -151,6 +170,27 @@ DEFINE_string(configure, "all",
               "- position - Configure 1 Hz position (PVTGeodetic2) and "
               "ephemeris (*Nav)");
 
+////////////////////////////////////////////////////////////////////////////////
+// Low-Power Settings
+////////////////////////////////////////////////////////////////////////////////
+
+DEFINE_bool(low_power, false,
+            "Coalesce input processing and output writes into periodic "
+            "batches aligned to the receiver epoch, rather than waking up for "
+            "every serial chunk and Polaris packet. Reduces CPU wakeups at the "
+            "cost of up to low_power_period_ms of added latency.");
+
+DEFINE_uint32(low_power_period_ms, 500,
+              "The interval at which buffered data is processed in low-power "
+              "mode, in milliseconds. Must evenly divide, or be a multiple of, "
+              "the receiver's 1 second epoch.");
+
+DEFINE_uint32(low_power_epoch_offset_ms, 100,
+              "The delay after each whole second (GPS/UTC) at which buffered "
+              "data is processed in low-power mode, in milliseconds. Allows "
+              "the receiver time to output its epoch data. Requires a "
+              "synchronized system clock.");
+
 /******************************************************************************/
 using namespace point_one::polaris;
 using namespace point_one::applications;
@@ -264,7 +304,29 @@ int main(int argc, char* argv[]) {
     long polaris_osr_in_bytes = 0;
     long polaris_ssr_in_bytes = 0;
     long correction_out_bytes = 0;
+    std::atomic<long> wakeups{0};
   } stats;
+  auto start_time = std::chrono::steady_clock::now();
+
+  // The low-power processing period must line up with the receiver's 1 second
+  // epochs, otherwise processing will drift relative to the epoch.
+  if (FLAGS_low_power &&
+      (FLAGS_low_power_period_ms == 0 ||
+       (1000 % FLAGS_low_power_period_ms != 0 &&
+        FLAGS_low_power_period_ms % 1000 != 0))) {
+    LOG(ERROR) << "Low-power processing period must evenly divide, or be a "
+                  "multiple of, 1000 ms.";
+    return 1;
+  }
+
+  if (FLAGS_polaris_ssr_preconnect_distance_km < 0.0) {
+    LOG(ERROR) << "SSR beacon pre-connect distance must not be negative.";
+    return 1;
+  }
+  else if (FLAGS_polaris_ssr_correction_window_sec < 0.0) {
+    LOG(ERROR) << "SSR correction window must not be negative.";
+    return 1;
+  }
 
   // Load geoid data.
   if (FLAGS_geoid_file.empty()) {
@@ -297,13 +359,28 @@ int main(int argc, char* argv[]) {
 
   // Open the serial port to the receiver through which we'll send RTCM
   // corrections.
+  //
+  // In low-power mode, corrections are accumulated and written to the port
+  // once per processing period (see drain_low_power_buffers below).
   SerialPort corrections_out_port(&io_service);
   corrections_out_port.Open(FLAGS_sbf_path, FLAGS_sbf_speed);
+  std::vector<uint8_t> pending_output;
   producer.SetRTCMCallback([&](const uint8_t* buffer, size_t size_bytes) {
     stats.correction_out_bytes += size_bytes;
-    corrections_out_port.Write(buffer, size_bytes);
+    if (FLAGS_low_power) {
+      pending_output.insert(pending_output.end(), buffer, buffer + size_bytes);
+    }
+    else {
+      corrections_out_port.Write(buffer, size_bytes);
+    }
   });
 
+  // In low-power mode, data received from Polaris is buffered here and passed
+  // to the producer in the next processing period.
+  std::mutex pending_input_lock;
+  std::vector<uint8_t> pending_osr_input;
+  std::vector<uint8_t> pending_ssr_input;
+
   // Configure the Septentio to send SBF and raw L-band byte streams.
   ConfigureSeptentrio(FLAGS_configure, corrections_out_port);
 
@@ -334,6 +411,13 @@ int main(int argc, char* argv[]) {
     polaris_osr_client->SetRTCMCallback(
         [&](const uint8_t* buffer, size_t size_bytes) {
           stats.polaris_osr_in_bytes += size_bytes;
+          ++stats.wakeups;
+          if (FLAGS_low_power) {
+            std::unique_lock<std::mutex> lock(pending_input_lock);
+            pending_osr_input.insert(pending_osr_input.end(), buffer,
+                                     buffer + size_bytes);
+            return;
+          }
           std::unique_lock<std::mutex> lock(producer_lock);
           producer.HandleOSR(buffer, size_bytes);
         });
@@ -342,7 +426,27 @@ int main(int argc, char* argv[]) {
 
   // If requested, create a Polaris client for SSR. Pass the corrections it
   // receives over the network to the OSR producer's SSR input.
+  //
+  // If multiple beacons are specified, the beacon manager will connect to the
+  // beacon covering the current position, pre-connecting to the next one when
+  // nearing a region boundary. Live data from the active beacon is passed to
+  // the producer. Data from the standby beacon is buffered, and the most recent
+  // correction window of it is replayed to the producer on handover.
+  auto handle_polaris_ssr_data = [&](const uint8_t* buffer,
+                                     size_t size_bytes) {
+    stats.polaris_ssr_in_bytes += size_bytes;
+    ++stats.wakeups;
+    if (FLAGS_low_power) {
+      std::unique_lock<std::mutex> lock(pending_input_lock);
+      pending_ssr_input.insert(pending_ssr_input.end(), buffer,
+                               buffer + size_bytes);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(producer_lock);
+    producer.HandleSSR(buffer, size_bytes);
+  };
   std::unique_ptr<point_one::polaris::PolarisClient> polaris_ssr_client;
+  std::unique_ptr<SSRBeaconManager> ssr_beacon_manager;
   if (FLAGS_polaris_ssr) {
     if (FLAGS_polaris_ssr_api_key.empty()) {
       LOG(ERROR) << "Please provide a Polaris SSR API key.";
@@ -352,27 +456,44 @@ int main(int argc, char* argv[]) {
     if (polaris_ssr_unique_id.empty()) {
       polaris_ssr_unique_id = FLAGS_polaris_osr_unique_id + "_ssr";
     }
-    polaris_ssr_client.reset(new PolarisClient(FLAGS_polaris_ssr_api_key,
-                                               polaris_ssr_unique_id));
-    if (!FLAGS_polaris_ssr_api_hostname.empty()) {
-      polaris_ssr_client->SetPolarisAuthenticationServer(
-          FLAGS_polaris_ssr_api_hostname);
-    }
-    if (!FLAGS_polaris_ssr_hostname.empty()) {
-      polaris_ssr_client->SetPolarisEndpoint(FLAGS_polaris_ssr_hostname);
+    auto create_ssr_client = [](const std::string& unique_id) {
+      std::unique_ptr<PolarisClient> client(
+          new PolarisClient(FLAGS_polaris_ssr_api_key, unique_id));
+      if (!FLAGS_polaris_ssr_api_hostname.empty()) {
+        client->SetPolarisAuthenticationServer(FLAGS_polaris_ssr_api_hostname);
+      }
+      if (!FLAGS_polaris_ssr_hostname.empty()) {
+        client->SetPolarisEndpoint(FLAGS_polaris_ssr_hostname);
+      }
+      return client;
+    };
+
+    if (!FLAGS_polaris_ssr_beacons.empty()) {
+      // Each beacon connection uses its own unique ID since the active and
+      // standby connections are open at the same time.
+      ssr_beacon_manager.reset(new SSRBeaconManager(
+          [create_ssr_client,
+           polaris_ssr_unique_id](const std::string& beacon_id) {
+            return create_ssr_client(polaris_ssr_unique_id + "_" + beacon_id);
+          },
+          handle_polaris_ssr_data,
+          FLAGS_polaris_ssr_preconnect_distance_km * 1e3,
+          FLAGS_polaris_ssr_correction_window_sec));
+      if (!ssr_beacon_manager->AddBeacons(FLAGS_polaris_ssr_beacons)) {
+        return 1;
+      }
+      LOG(INFO) << "Waiting for position to select an SSR beacon.";
     }
-    if (FLAGS_polaris_ssr_beacon.empty()) {
-      LOG(ERROR) << "Please provide a Polaris SSR beacon ID.";
-      return 1;
+    else {
+      if (FLAGS_polaris_ssr_beacon.empty()) {
+        LOG(ERROR) << "Please provide a Polaris SSR beacon ID.";
+        return 1;
+      }
+      polaris_ssr_client = create_ssr_client(polaris_ssr_unique_id);
+      polaris_ssr_client->RequestBeacon(FLAGS_polaris_ssr_beacon);
+      polaris_ssr_client->SetRTCMCallback(handle_polaris_ssr_data);
+      polaris_ssr_client->RunAsync();
     }
-    polaris_ssr_client->RequestBeacon(FLAGS_polaris_ssr_beacon);
-    polaris_ssr_client->SetRTCMCallback(
-        [&](const uint8_t* buffer, size_t size_bytes) {
-          stats.polaris_ssr_in_bytes += size_bytes;
-          std::unique_lock<std::mutex> lock(producer_lock);
-          producer.HandleSSR(buffer, size_bytes);
-        });
-    polaris_ssr_client->RunAsync();
   }
 
   // Hook into the OSR producer's SetPositionTimeCallback so that when it
@@ -385,6 +506,13 @@ int main(int argc, char* argv[]) {
     if (week<0 || std::isnan(time_of_week_secs)) {
       return;
     }
+    // Update the SSR beacon selection on every position update so we can
+    // pre-connect before reaching a region boundary. The beacon manager
+    // connects and disconnects clients on its own thread, so this does not
+    // block receiver input.
+    if (ssr_beacon_manager) {
+      ssr_beacon_manager->SetPosition(lla_deg[0], lla_deg[1]);
+    }
     // Limit position updates to not more frequent than once every 30s.
     if (last_week == week &&
         time_of_week_secs < last_position_time_seconds + 30.0) {
@@ -400,16 +528,27 @@ int main(int argc, char* argv[]) {
       polaris_osr_client->SendLLAPosition(lla_deg[0], lla_deg[1], lla_deg[2]);
     }
     // Note that for SSR we currently subscribe to the stream for a specific
-    // region manually. We do not call SendLLAPosition() for the SSR Polaris
-    // client. Doing so may disconnect the SSR data stream unexpectedly.
-    // This is subject to change in the future.
+    // region manually (or select one using the beacon manager). We do not call
+    // SendLLAPosition() for the SSR Polaris client. Doing so may disconnect the
+    // SSR data stream unexpectedly. This is subject to change in the future.
   };
   producer.SetPositionTimeCallback(position_updater);
 
   // Open a serial port from which to read the receiver's raw L-band messages.
   // Pass these messages to the OSR producer's secondary SSR input.
+  //
+  // In low-power mode, the serial ports are opened without a read callback.
+  // Incoming data is left in the kernel's buffer and read in the next
+  // processing period.
   SerialPort lband_port(&io_service);
   int lband_log_fd = -1;
+  auto handle_lband_data = [&](const uint8_t* data, size_t size_bytes) {
+    stats.lband_in_bytes += size_bytes;
+    if (-1 != lband_log_fd) {
+      write(lband_log_fd, data, size_bytes);
+    }
+    producer.HandleSecondarySSR(data, size_bytes);
+  };
   if (FLAGS_lband) {
     if (!FLAGS_lband_log_path.empty()) {
       lband_log_fd = open(FLAGS_lband_log_path.c_str(),
@@ -420,32 +559,125 @@ int main(int argc, char* argv[]) {
         return 1;
       }
     }
-    lband_port.Open(FLAGS_lband_path, FLAGS_lband_speed,
-                    [&](const uint8_t* data, size_t size_bytes) {
-                      stats.lband_in_bytes += size_bytes;
-                      if (-1 != lband_log_fd) {
-                        write(lband_log_fd, data, size_bytes);
-                      }
-                      std::unique_lock<std::mutex> lock(producer_lock);
-                      producer.HandleSecondarySSR(data, size_bytes);
-                    });
+    if (FLAGS_low_power) {
+      lband_port.Open(FLAGS_lband_path, FLAGS_lband_speed);
+    }
+    else {
+      lband_port.Open(FLAGS_lband_path, FLAGS_lband_speed,
+                      [&](const uint8_t* data, size_t size_bytes) {
+                        ++stats.wakeups;
+                        std::unique_lock<std::mutex> lock(producer_lock);
+                        handle_lband_data(data, size_bytes);
+                      });
+    }
   }
 
   // Open a serial port from which to read the Septentrio's SBF messages.
   // Pass these mesasges to the OSR producer via its receiver data input.
   SerialPort sbf_port(&io_service);
-  sbf_port.Open(FLAGS_sbf_path, FLAGS_sbf_speed,
-                [&](const uint8_t* data, size_t size_bytes) {
-                  stats.sbf_in_bytes += size_bytes;
-                  std::unique_lock<std::mutex> lock(producer_lock);
-                  producer.HandleReceiverData(data, size_bytes);
-                });
+  auto handle_sbf_data = [&](const uint8_t* data, size_t size_bytes) {
+    stats.sbf_in_bytes += size_bytes;
+    producer.HandleReceiverData(data, size_bytes);
+  };
+  if (FLAGS_low_power) {
+    sbf_port.Open(FLAGS_sbf_path, FLAGS_sbf_speed);
+  }
+  else {
+    sbf_port.Open(FLAGS_sbf_path, FLAGS_sbf_speed,
+                  [&](const uint8_t* data, size_t size_bytes) {
+                    ++stats.wakeups;
+                    std::unique_lock<std::mutex> lock(producer_lock);
+                    handle_sbf_data(data, size_bytes);
+                  });
+  }
+
+  // In low-power mode, process all buffered input and write all resulting
+  // output once per period. Periods are aligned to whole seconds of the system
+  // clock, and thus to the receiver's epochs provided the system clock is
+  // synchronized (GPS time and UTC differ by an integer number of seconds).
+  //
+  // The timer is only accessed from the IO thread. On shutdown, it is stopped
+  // from the IO thread as well (see below).
+  boost::asio::steady_timer low_power_timer(io_service);
+  std::atomic<bool> low_power_stopped(false);
+  std::function<void()> schedule_low_power_drain;
+  auto drain_low_power_buffers = [&]() {
+    ++stats.wakeups;
+
+    std::vector<uint8_t> osr_input;
+    std::vector<uint8_t> ssr_input;
+    {
+      std::unique_lock<std::mutex> lock(pending_input_lock);
+      osr_input.swap(pending_osr_input);
+      ssr_input.swap(pending_ssr_input);
+    }
+
+    // Pass corrections in first so they are available when the receiver's
+    // epoch data triggers RTCM generation.
+    {
+      std::unique_lock<std::mutex> lock(producer_lock);
+      if (!osr_input.empty()) {
+        producer.HandleOSR(osr_input.data(), osr_input.size());
+      }
+      if (!ssr_input.empty()) {
+        producer.HandleSSR(ssr_input.data(), ssr_input.size());
+      }
+      lband_port.ReadAvailable(handle_lband_data);
+      sbf_port.ReadAvailable(handle_sbf_data);
+    }
+
+    if (!pending_output.empty()) {
+      corrections_out_port.Write(pending_output.data(), pending_output.size());
+      pending_output.clear();
+    }
+  };
+  schedule_low_power_drain = [&]() {
+    const long period_ms = FLAGS_low_power_period_ms;
+    const long offset_ms = FLAGS_low_power_epoch_offset_ms % 1000;
+    long now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
+    long next_ms = ((now_ms - offset_ms) / period_ms + 1) * period_ms +
+                   offset_ms;
+    low_power_timer.expires_from_now(
+        std::chrono::milliseconds(next_ms - now_ms));
+    low_power_timer.async_wait([&](const boost::system::error_code& error) {
+      // Note: A handler that was already queued when the timer was canceled
+      // is called with success, so check the stop flag as well.
+      if (error == boost::asio::error::operation_aborted ||
+          low_power_stopped) {
+        return;
+      }
+      drain_low_power_buffers();
+      schedule_low_power_drain();
+    });
+  };
+  if (FLAGS_low_power) {
+    LOG(INFO) << "Low-power mode enabled. Processing data every "
+              << FLAGS_low_power_period_ms << " ms.";
+    io_service.post(schedule_low_power_drain);
+  }
 
   signal_listener::ListenTo({SIGABRT, SIGINT, SIGTERM});
   signal_listener::Wait();
 
   LOG(INFO) << "Shutting down.";
 
+  // Stop the low-power timer from the IO thread, since the timer may not be
+  // used concurrently. Then perform one last drain so that any buffered input
+  // is processed and the resulting corrections are written before the ports
+  // are closed.
+  if (FLAGS_low_power) {
+    std::promise<void> low_power_done;
+    io_service.post([&]() {
+      low_power_stopped = true;
+      low_power_timer.cancel();
+      drain_low_power_buffers();
+      low_power_done.set_value();
+    });
+    low_power_done.get_future().wait();
+  }
+
   sbf_port.Close();
 
   lband_port.Close();
@@ -456,6 +688,10 @@ int main(int argc, char* argv[]) {
 
   polaris_ssr_client.reset();
 
+  if (ssr_beacon_manager) {
+    ssr_beacon_manager->Stop();
+  }
+
   polaris_osr_client.reset();
 
   corrections_out_port.Close();
@@ -472,8 +708,50 @@ int main(int argc, char* argv[]) {
             << "  OSR bytes read from Polaris server";
   LOG(INFO) << std::setw(12) << std::setfill(' ') << stats.polaris_ssr_in_bytes
             << "  SSR bytes read from Polaris server";
+  if (ssr_beacon_manager) {
+    SSRBeaconManager::Stats handover_stats = ssr_beacon_manager->GetStats();
+    LOG(INFO) << std::setw(12) << std::setfill(' ') << handover_stats.handovers
+              << "  SSR beacon handovers";
+    LOG(INFO) << std::setw(12) << std::setfill(' ')
+              << handover_stats.incomplete_handovers
+              << "  SSR beacon handovers incomplete (superseded or at "
+                 "shutdown)";
+    if (handover_stats.handovers > 0) {
+      LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+                << std::setprecision(3)
+                << handover_stats.total_gap_sec / handover_stats.handovers
+                << "  Mean SSR handover correction gap (sec)";
+      LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+                << std::setprecision(3) << handover_stats.max_gap_sec
+                << "  Max SSR handover correction gap (sec)";
+    }
+  }
   LOG(INFO) << std::setw(12) << std::setfill(' ') << stats.correction_out_bytes
             << "  Correction OSR bytes written to receiver";
 
+  // Report wakeup rate and CPU usage, e.g., to compare power consumption with
+  // and without --low_power.
+  double elapsed_sec = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start_time)
+                           .count();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double cpu_sec = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+                   usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+  LOG(INFO) << "Power Stats (" << std::fixed << std::setprecision(1)
+            << elapsed_sec << " sec" << (FLAGS_low_power ? ", low-power" : "")
+            << "):";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+            << std::setprecision(2) << stats.wakeups / elapsed_sec
+            << "  Input processing wakeups/sec";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+            << std::setprecision(2) << usage.ru_nvcsw / elapsed_sec
+            << "  Voluntary context switches/sec (all threads)";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+            << std::setprecision(3) << cpu_sec << "  CPU seconds (user + system)";
+  LOG(INFO) << std::setw(12) << std::setfill(' ') << std::fixed
+            << std::setprecision(3)
+            << 100.0 * cpu_sec / elapsed_sec << "  CPU utilization (%)";
+
   return 0;
 }
@@ -4,6 +4,11 @@
 
 #include "serial_port.h"
 
+#include <sys/ioctl.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
 #include <boost/bind/bind.hpp>
 
 #include <glog/logging.h>
@@ -11,6 +16,9 @@
 using namespace boost::asio::ip;
 using namespace point_one::applications;
 
+/******************************************************************************/
+const int SerialPort::READ_SIZE;
+
 /******************************************************************************/
 SerialPort::SerialPort(boost::asio::io_service* io_svs)
     : io_service_(io_svs), port_(*io_svs), shutting_down_(false) {}
@@ -93,6 +101,40 @@ void SerialPort::Write(const std::string& buf) {
   Write(reinterpret_cast<const uint8_t*>(buf.data()), buf.size());
 }
 
+/******************************************************************************/
+size_t SerialPort::ReadAvailable(const CallbackFn& callback) {
+  if (!port_.is_open()) return 0;
+
+  size_t total_bytes = 0;
+  while (true) {
+    int available = 0;
+    if (ioctl(port_.native_handle(), FIONREAD, &available) < 0) {
+      LOG(ERROR) << "Error querying available bytes on '" << port_name_
+                 << "': " << strerror(errno);
+      break;
+    }
+    else if (available <= 0) {
+      break;
+    }
+
+    boost::system::error_code error_code;
+    size_t bytes_read = port_.read_some(
+        boost::asio::buffer(buf_, std::min(available, READ_SIZE)), error_code);
+    if (error_code) {
+      LOG(ERROR) << "Error reading data on '" << port_name_ << "'; "
+                 << error_code.message();
+      break;
+    }
+
+    VLOG(4) << "Read " << bytes_read << " buffered bytes on '" << port_name_
+            << "'.";
+    total_bytes += bytes_read;
+    if (callback) callback((uint8_t*)buf_, bytes_read);
+  }
+
+  return total_bytes;
+}
+
 /******************************************************************************/
 bool SerialPort::SetSpeed(boost::asio::serial_port& p, unsigned baud_rate_bps) {
   termios t;
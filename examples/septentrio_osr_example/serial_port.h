@@ -37,6 +37,20 @@ class SerialPort {
 
   void Write(const std::string& buf);
 
+  /**
+   * @brief Read all bytes currently buffered by the kernel for this port
+   *        without blocking.
+   *
+   * For use when the port was opened without a callback, so that data is left
+   * to accumulate in the kernel's buffer between polls rather than waking the
+   * IO thread for every chunk.
+   *
+   * @param callback The function to be called with each block of data read.
+   *
+   * @return The number of bytes read.
+   */
+  size_t ReadAvailable(const CallbackFn& callback);
+
  private:
   boost::asio::io_service* io_service_;
   boost::asio::serial_port port_;
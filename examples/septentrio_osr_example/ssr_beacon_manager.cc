@@ -0,0 +1,368 @@
+/**
+ * @brief Position-driven selection of Polaris SSR beacons with pre-connected
+ *        handover between coverage regions.
+ */
+
+#include "ssr_beacon_manager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include <glog/logging.h>
+
+using namespace point_one::applications;
+using namespace point_one::polaris;
+
+namespace {
+
+// Stay with the active beacon until we are this fraction of the pre-connect
+// distance (but at least the minimum margin) outside its region, so position
+// noise near a shared region boundary does not cause repeated handovers.
+constexpr double HANDOVER_MARGIN_FRACTION = 0.1;
+constexpr double MIN_HANDOVER_MARGIN_M = 100.0;
+
+} // namespace
+
+/******************************************************************************/
+SSRBeaconManager::SSRBeaconManager(const ClientFactoryFn& factory,
+                                   const CallbackFn& callback,
+                                   double preconnect_distance_m,
+                                   double correction_window_sec)
+    : factory_(factory),
+      callback_(callback),
+      preconnect_distance_m_(preconnect_distance_m),
+      handover_margin_m_(std::max(
+          preconnect_distance_m * HANDOVER_MARGIN_FRACTION,
+          MIN_HANDOVER_MARGIN_M)),
+      correction_window_(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(correction_window_sec))) {
+  worker_thread_ = std::thread(&SSRBeaconManager::Run, this);
+}
+
+/******************************************************************************/
+SSRBeaconManager::~SSRBeaconManager() { Stop(); }
+
+/******************************************************************************/
+bool SSRBeaconManager::AddBeacons(const std::string& spec) {
+  std::istringstream stream(spec);
+  std::string entry;
+  while (std::getline(stream, entry, ';')) {
+    if (entry.empty()) {
+      continue;
+    }
+
+    size_t separator = entry.find('=');
+    Beacon beacon;
+    char trailing;
+    if (separator == std::string::npos || separator == 0 ||
+        sscanf(entry.c_str() + separator + 1, "%lf,%lf,%lf,%lf%c",
+               &beacon.lat_min_deg, &beacon.lon_min_deg, &beacon.lat_max_deg,
+               &beacon.lon_max_deg, &trailing) != 4) {
+      LOG(ERROR) << "Invalid SSR beacon specification \"" << entry
+                 << "\". Expected ID=LAT_MIN,LON_MIN,LAT_MAX,LON_MAX.";
+      return false;
+    }
+    else if (beacon.lat_min_deg > beacon.lat_max_deg ||
+             beacon.lon_min_deg > beacon.lon_max_deg) {
+      LOG(ERROR) << "Invalid coverage region for SSR beacon \"" << entry
+                 << "\". Minimum exceeds maximum.";
+      return false;
+    }
+
+    beacon.id = entry.substr(0, separator);
+    VLOG(1) << "Added SSR beacon " << beacon.id << " covering ["
+            << beacon.lat_min_deg << ", " << beacon.lon_min_deg << "] to ["
+            << beacon.lat_max_deg << ", " << beacon.lon_max_deg << "].";
+    beacons_.push_back(beacon);
+  }
+
+  if (beacons_.empty()) {
+    LOG(ERROR) << "No SSR beacons specified.";
+    return false;
+  }
+
+  return true;
+}
+
+/******************************************************************************/
+void SSRBeaconManager::SetPosition(double latitude_deg, double longitude_deg) {
+  std::unique_lock<std::mutex> lock(position_lock_);
+  pending_latitude_deg_ = latitude_deg;
+  pending_longitude_deg_ = longitude_deg;
+  position_pending_ = true;
+  position_cv_.notify_one();
+}
+
+/******************************************************************************/
+void SSRBeaconManager::Stop() {
+  {
+    std::unique_lock<std::mutex> lock(position_lock_);
+    stopping_ = true;
+    position_cv_.notify_one();
+  }
+
+  if (worker_thread_.joinable()) {
+    worker_thread_.join();
+  }
+
+  clients_.clear();
+
+  // Report a handover that did not complete before shutdown.
+  std::unique_lock<std::mutex> lock(data_lock_);
+  if (handover_pending_) {
+    LOG(WARNING) << "SSR handover to beacon " << active_beacon_id_
+                 << " incomplete at shutdown.";
+    RecordHandover(Clock::now(), false);
+  }
+}
+
+/******************************************************************************/
+void SSRBeaconManager::Run() {
+  while (true) {
+    double latitude_deg, longitude_deg;
+    {
+      std::unique_lock<std::mutex> lock(position_lock_);
+      position_cv_.wait(lock, [&] { return position_pending_ || stopping_; });
+      if (stopping_) {
+        return;
+      }
+      latitude_deg = pending_latitude_deg_;
+      longitude_deg = pending_longitude_deg_;
+      position_pending_ = false;
+    }
+
+    UpdatePosition(latitude_deg, longitude_deg);
+  }
+}
+
+/******************************************************************************/
+void SSRBeaconManager::UpdatePosition(double latitude_deg,
+                                      double longitude_deg) {
+  if (beacons_.empty()) {
+    return;
+  }
+
+  std::string active_beacon_id;
+  {
+    std::unique_lock<std::mutex> lock(data_lock_);
+    active_beacon_id = active_beacon_id_;
+  }
+
+  // Select the beacon covering the current position. If we are not in any
+  // region, use the nearest one. To avoid unnecessary handovers, stay with the
+  // active beacon while we are within the handover margin of its region, even
+  // if another region is closer.
+  const Beacon* target = nullptr;
+  const Beacon* active = nullptr;
+  double target_distance_m = 0.0;
+  double active_distance_m = 0.0;
+  std::vector<std::pair<double, const Beacon*>> distances;
+  for (const auto& beacon : beacons_) {
+    double distance_m =
+        GetDistanceToBeaconM(beacon, latitude_deg, longitude_deg);
+    distances.emplace_back(distance_m, &beacon);
+    if (target == nullptr || distance_m < target_distance_m) {
+      target = &beacon;
+      target_distance_m = distance_m;
+    }
+    if (beacon.id == active_beacon_id) {
+      active = &beacon;
+      active_distance_m = distance_m;
+    }
+  }
+
+  if (active != nullptr && active_distance_m <= handover_margin_m_) {
+    target = active;
+  }
+
+  // Pre-connect to the nearest neighboring beacon, if we are approaching its
+  // region.
+  const Beacon* standby = nullptr;
+  std::sort(distances.begin(), distances.end());
+  for (const auto& entry : distances) {
+    if (entry.second != target && entry.first <= preconnect_distance_m_) {
+      standby = entry.second;
+      break;
+    }
+  }
+
+  // Connect to the target and standby beacons if not already connected.
+  for (const Beacon* beacon : {target, standby}) {
+    if (beacon == nullptr || clients_.count(beacon->id) > 0) {
+      continue;
+    }
+
+    LOG(INFO) << "Connecting to SSR beacon " << beacon->id << " ("
+              << (beacon == target ? "active" : "standby") << ").";
+    std::unique_ptr<PolarisClient> client = factory_(beacon->id);
+    std::string beacon_id = beacon->id;
+    client->SetRTCMCallback([this, beacon_id](const uint8_t* buffer,
+                                              size_t size_bytes) {
+      OnData(beacon_id, buffer, size_bytes);
+    });
+    client->RequestBeacon(beacon_id);
+    client->RunAsync();
+    clients_[beacon_id] = std::move(client);
+  }
+
+  // Switch the SSR input to the target beacon. Data from the previous beacon
+  // is forwarded up until this point. If the target was already connected, we
+  // replay its most recent data so the producer has a complete correction set
+  // immediately.
+  if (target->id != active_beacon_id) {
+    std::unique_lock<std::mutex> lock(data_lock_);
+    Clock::time_point now = Clock::now();
+    if (active_beacon_id_.empty()) {
+      LOG(INFO) << "Using SSR beacon " << target->id << ".";
+    }
+    else {
+      LOG(INFO) << "Handing over SSR from beacon " << active_beacon_id_
+                << " to " << target->id << ".";
+      // If the previous handover has not completed yet, record it as
+      // incomplete. The correction gap continues into the new handover, which
+      // is measured from here on so the time is not counted twice.
+      if (handover_pending_) {
+        LOG(WARNING) << "SSR handover to beacon " << active_beacon_id_
+                     << " superseded before completing.";
+        RecordHandover(now, false);
+        handover_start_time_ = now;
+      }
+      else {
+        handover_start_time_ =
+            last_data_time_ == Clock::time_point() ? now : last_data_time_;
+      }
+      handover_pending_ = true;
+    }
+    active_beacon_id_ = target->id;
+
+    auto& history = beacon_data_[target->id].history;
+    if (!history.empty()) {
+      VLOG(1) << "Replaying " << history.size()
+              << " buffered SSR update(s) from beacon " << target->id << ".";
+      for (const auto& entry : history) {
+        callback_(entry.second.data(), entry.second.size());
+      }
+      history.clear();
+    }
+    CheckHandoverComplete(now);
+  }
+
+  // Disconnect from beacons that are no longer needed. The client is destroyed
+  // first so no more data arrives for it once its buffered data is removed.
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    if (it->first == target->id ||
+        (standby != nullptr && it->first == standby->id)) {
+      ++it;
+    }
+    else {
+      LOG(INFO) << "Disconnecting from SSR beacon " << it->first << ".";
+      std::string beacon_id = it->first;
+      it = clients_.erase(it);
+      std::unique_lock<std::mutex> lock(data_lock_);
+      beacon_data_.erase(beacon_id);
+    }
+  }
+}
+
+/******************************************************************************/
+SSRBeaconManager::Stats SSRBeaconManager::GetStats() const {
+  std::unique_lock<std::mutex> lock(data_lock_);
+  return stats_;
+}
+
+/******************************************************************************/
+void SSRBeaconManager::OnData(const std::string& beacon_id,
+                              const uint8_t* buffer, size_t size_bytes) {
+  // Note: The lock is held while calling the callback so that no data from the
+  // previous beacon is delivered after a handover, and no live data from the
+  // new beacon is delivered before its buffered data is replayed.
+  std::unique_lock<std::mutex> lock(data_lock_);
+
+  Clock::time_point now = Clock::now();
+  BeaconData& data = beacon_data_[beacon_id];
+  if (data.first_data_time == Clock::time_point()) {
+    data.first_data_time = now;
+  }
+
+  // Data from a standby beacon is buffered until we hand over to it. Only the
+  // most recent correction window is kept.
+  if (beacon_id != active_beacon_id_) {
+    data.history.emplace_back(
+        now, std::vector<uint8_t>(buffer, buffer + size_bytes));
+    while (!data.history.empty() &&
+           data.history.front().first + correction_window_ < now) {
+      data.history.pop_front();
+    }
+    return;
+  }
+
+  last_data_time_ = now;
+  callback_(buffer, size_bytes);
+  CheckHandoverComplete(now);
+}
+
+/******************************************************************************/
+void SSRBeaconManager::CheckHandoverComplete(Clock::time_point now) {
+  // The handover is complete once the new beacon has provided a full
+  // correction window of data, either live or replayed from the standby
+  // buffer. Called with the data lock held.
+  if (!handover_pending_) {
+    return;
+  }
+
+  const BeaconData& data = beacon_data_[active_beacon_id_];
+  if (data.first_data_time == Clock::time_point() ||
+      now - data.first_data_time < correction_window_) {
+    return;
+  }
+
+  RecordHandover(now, true);
+}
+
+/******************************************************************************/
+void SSRBeaconManager::RecordHandover(Clock::time_point now, bool complete) {
+  // Called with the data lock held.
+  double gap_sec =
+      std::chrono::duration<double>(now - handover_start_time_).count();
+  if (complete) {
+    LOG(INFO) << "SSR handover to beacon " << active_beacon_id_
+              << " complete. Correction gap: " << gap_sec << " sec.";
+  }
+  else {
+    ++stats_.incomplete_handovers;
+  }
+
+  handover_pending_ = false;
+  ++stats_.handovers;
+  stats_.total_gap_sec += gap_sec;
+  stats_.max_gap_sec = std::max(stats_.max_gap_sec, gap_sec);
+}
+
+/******************************************************************************/
+double SSRBeaconManager::GetDistanceToBeaconM(const Beacon& beacon,
+                                              double latitude_deg,
+                                              double longitude_deg) {
+  // Find the closest point within the region, then compute the great circle
+  // distance to it. Regions spanning the antimeridian are not supported.
+  static constexpr double EARTH_RADIUS_M = 6371000.0;
+  static constexpr double DEG_TO_RAD = M_PI / 180.0;
+
+  double closest_lat_deg =
+      std::min(std::max(latitude_deg, beacon.lat_min_deg), beacon.lat_max_deg);
+  double closest_lon_deg = std::min(std::max(longitude_deg, beacon.lon_min_deg),
+                                    beacon.lon_max_deg);
+  if (closest_lat_deg == latitude_deg && closest_lon_deg == longitude_deg) {
+    return 0.0;
+  }
+
+  double lat1_rad = latitude_deg * DEG_TO_RAD;
+  double lat2_rad = closest_lat_deg * DEG_TO_RAD;
+  double sin_dlat = std::sin((lat2_rad - lat1_rad) / 2.0);
+  double sin_dlon =
+      std::sin((closest_lon_deg - longitude_deg) * DEG_TO_RAD / 2.0);
+  double a = sin_dlat * sin_dlat +
+             std::cos(lat1_rad) * std::cos(lat2_rad) * sin_dlon * sin_dlon;
+  return 2.0 * EARTH_RADIUS_M * std::asin(std::min(1.0, std::sqrt(a)));
+}
@@ -0,0 +1,180 @@
+/**
+ * @brief Position-driven selection of Polaris SSR beacons with pre-connected
+ *        handover between coverage regions.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <point_one/polaris/polaris_client.h>
+
+namespace point_one {
+namespace applications {
+
+class SSRBeaconManager {
+ public:
+  typedef std::function<void(const uint8_t*, size_t)> CallbackFn;
+
+  /**
+   * @brief Create a new Polaris client for the specified beacon.
+   *
+   * The manager will set the client's RTCM callback, request the beacon, and
+   * start the client.
+   */
+  typedef std::function<std::unique_ptr<polaris::PolarisClient>(
+      const std::string& beacon_id)>
+      ClientFactoryFn;
+
+  /**
+   * @brief A beacon and the latitude/longitude bounding box it covers.
+   */
+  struct Beacon {
+    std::string id;
+    double lat_min_deg = 0.0;
+    double lon_min_deg = 0.0;
+    double lat_max_deg = 0.0;
+    double lon_max_deg = 0.0;
+  };
+
+  /**
+   * @brief Handover statistics.
+   *
+   * The correction gap for a handover is the time from the last data received
+   * from the previous beacon until the producer has been given a complete
+   * correction set from the new beacon, i.e., a full correction window of data
+   * (see @ref SSRBeaconManager()). If the new beacon was pre-connected for at
+   * least one window, its buffered data is replayed at the handover and the
+   * gap is close to zero.
+   *
+   * A handover that is superseded by another handover, or is still in progress
+   * at shutdown, is counted as incomplete. Its gap is measured up to that
+   * point.
+   */
+  struct Stats {
+    long handovers = 0;
+    long incomplete_handovers = 0;
+    double total_gap_sec = 0.0;
+    double max_gap_sec = 0.0;
+  };
+
+  SSRBeaconManager() = delete;
+
+  /**
+   * @brief Construct a beacon manager.
+   *
+   * @param factory A function creating Polaris clients for individual beacons.
+   * @param callback The function to be called with SSR data received from the
+   *        active beacon.
+   * @param preconnect_distance_m Open a standby connection to a neighboring
+   *        beacon when within this distance of its coverage region. The active
+   *        beacon is kept until we are 10% of this distance (at least 100 m)
+   *        outside its region.
+   * @param correction_window_sec The time over which a beacon sends a complete
+   *        set of SSR corrections. The most recent window of data from the
+   *        standby beacon is buffered and passed to the callback on handover.
+   */
+  SSRBeaconManager(const ClientFactoryFn& factory, const CallbackFn& callback,
+                   double preconnect_distance_m, double correction_window_sec);
+
+  ~SSRBeaconManager();
+
+  /**
+   * @brief Add beacons from a specification string.
+   *
+   * @param spec A `;`-separated list of beacons, each formatted as
+   *        `ID=LAT_MIN,LON_MIN,LAT_MAX,LON_MAX` (degrees).
+   *
+   * @return `true` on success, `false` if the string could not be parsed or
+   *         no beacons have been added.
+   */
+  bool AddBeacons(const std::string& spec);
+
+  /**
+   * @brief Update the current position.
+   *
+   * Beacons are connected to, pre-connected to, or disconnected from as needed
+   * on the manager's own thread, so this function does not block on Polaris
+   * client creation or shutdown. If several updates arrive before the previous
+   * one is handled, only the most recent position is used.
+   *
+   * @note
+   * All beacons must be added with @ref AddBeacons() before the first position
+   * update.
+   */
+  void SetPosition(double latitude_deg, double longitude_deg);
+
+  /**
+   * @brief Disconnect from all beacons. Subsequent position updates are
+   *        ignored.
+   */
+  void Stop();
+
+  Stats GetStats() const;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  ClientFactoryFn factory_;
+  CallbackFn callback_;
+  double preconnect_distance_m_;
+  double handover_margin_m_;
+  Clock::duration correction_window_;
+  std::vector<Beacon> beacons_;
+
+  // Pending position updates, handled by the worker thread.
+  std::mutex position_lock_;
+  std::condition_variable position_cv_;
+  bool position_pending_ = false;
+  bool stopping_ = false;
+  double pending_latitude_deg_ = 0.0;
+  double pending_longitude_deg_ = 0.0;
+  std::thread worker_thread_;
+
+  // Only accessed by the worker thread, and by Stop() after the worker thread
+  // has exited.
+  std::map<std::string, std::unique_ptr<polaris::PolarisClient>> clients_;
+
+  // Data received from a connected beacon.
+  struct BeaconData {
+    Clock::time_point first_data_time;
+    // Recent data from a standby beacon, to be replayed on handover.
+    std::deque<std::pair<Clock::time_point, std::vector<uint8_t>>> history;
+  };
+
+  // Protects the active beacon state, accessed from the Polaris client
+  // threads.
+  mutable std::mutex data_lock_;
+  std::map<std::string, BeaconData> beacon_data_;
+  std::string active_beacon_id_;
+  bool handover_pending_ = false;
+  Clock::time_point handover_start_time_;
+  Clock::time_point last_data_time_;
+  Stats stats_;
+
+  void Run();
+
+  void UpdatePosition(double latitude_deg, double longitude_deg);
+
+  void OnData(const std::string& beacon_id, const uint8_t* buffer,
+              size_t size_bytes);
+
+  void CheckHandoverComplete(Clock::time_point now);
+
+  void RecordHandover(Clock::time_point now, bool complete);
+
+  static double GetDistanceToBeaconM(const Beacon& beacon, double latitude_deg,
+                                     double longitude_deg);
+};
+
+} // namespace applications
+} // namespace point_one